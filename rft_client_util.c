@@ -0,0 +1,630 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/udp.h>  // for UDP_SEGMENT
+#include <arpa/inet.h>
+#include "rft_util.h"
+#include "rft_client_util.h"
+#include "rft_prof.h"
+
+/*
+ * Implementation of the client functions declared and documented in
+ * rft_client_util.h
+ */
+
+#define ACK_TIMEOUT_SEC 2   // seconds to wait for an ACK before resending
+#define MAX_TIMEOUTS 10     // timeouts in a row before a fan-out server is
+                            // dropped from the transfer
+
+/*
+ * is_corrupted - returns true with the given probability, used to decide
+ * whether to inject corruption into the checksum of a data segment
+ */
+static bool is_corrupted(float prob) {
+    float r = (float) rand();
+    float max = (float) RAND_MAX;
+
+    return prob >= r / max;
+}
+
+/*
+ * enable_udp_gso - probe for UDP generic segmentation offload (Linux only)
+ * and, if available, have the kernel split each send on the socket into
+ * segment_t sized datagrams. Returns true if GSO is enabled on the socket.
+ */
+static bool enable_udp_gso(int sockfd) {
+#ifdef UDP_SEGMENT
+    int gso_size = (int) sizeof(segment_t);
+
+    return !setsockopt(sockfd, IPPROTO_UDP, UDP_SEGMENT, &gso_size,
+                sizeof(int));
+#else
+    return false;
+#endif
+}
+
+/*
+ * send_segments - send count contiguous data segments to the server. With
+ * GSO enabled they are handed to the kernel as one buffer, otherwise they
+ * are sent one datagram at a time. If the device refuses a GSO send, GSO
+ * is switched off (gso is cleared) and the segments are sent one by one.
+ * Returns the number of bytes sent, or -1 on error.
+ */
+static ssize_t send_segments(int sockfd, struct sockaddr_in* server,
+    segment_t* segs, int count, bool* gso) {
+    size_t seg_size = sizeof(segment_t);
+    socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
+
+    if (*gso && count > 1) {
+        ssize_t bytes = sendto(sockfd, segs, count * seg_size, 0,
+                        (struct sockaddr*) server, addr_len);
+
+        if (bytes >= 0 || errno != EIO)
+            return bytes;
+
+#ifdef UDP_SEGMENT
+        int off = 0;
+        setsockopt(sockfd, IPPROTO_UDP, UDP_SEGMENT, &off, sizeof(int));
+#endif
+        *gso = false;
+    }
+
+    ssize_t total = 0;
+
+    for (int i = 0; i < count; i++) {
+        ssize_t bytes = sendto(sockfd, &segs[i], seg_size, 0,
+                        (struct sockaddr*) server, addr_len);
+
+        if (bytes < 0)
+            return bytes;
+
+        total += bytes;
+    }
+
+    return total;
+}
+
+/*
+ * print_sent_segment - print information messages for a segment sent to
+ * the server
+ */
+static void print_sent_segment(segment_t* data_msg) {
+    char inf_msg_buf[INF_MSG_SIZE];
+
+    if (data_msg->type == ZERO_SEG) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE,
+            "Zero range with sq: %d sent, zero bytes: %zu", data_msg->sq,
+            data_msg->payload_bytes);
+        print_cmsg(inf_msg_buf);
+    } else {
+        snprintf(inf_msg_buf, INF_MSG_SIZE,
+            "Segment with sq: %d sent, payload bytes: %zu, checksum: %d",
+            data_msg->sq, data_msg->payload_bytes, data_msg->checksum);
+        print_cmsg(inf_msg_buf);
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Sent payload:\n%s",
+            data_msg->payload);
+        print_cmsg(inf_msg_buf);
+    }
+
+    print_sep();
+}
+
+void print_cmsg(char* msg) {
+    print_msg("CLIENT", msg);
+}
+
+void print_cerr(int line, char* msg) {
+    print_err("CLIENT", line, msg);
+}
+
+void exit_cerr(int line, char* msg) {
+    print_cerr(line, msg);
+    exit(EXIT_FAILURE);
+}
+
+int create_udp_socket(struct sockaddr_in* server, char* server_addr, int port) {
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (sockfd == -1)
+        exit_cerr(__LINE__, "Failed to open socket");
+
+    print_cmsg("Socket created");
+
+    /* Fill in the server address structure */
+    server->sin_family = AF_INET;
+    server->sin_addr.s_addr = inet_addr(server_addr);
+    server->sin_port = htons(port);  // convert to network byte order
+
+    return sockfd;
+}
+
+bool send_metadata(int sockfd, struct sockaddr_in* server, off_t file_size,
+    char* output_file, int priority) {
+    metadata_t file_inf;
+    prepare_metadata(&file_inf, file_size, output_file, priority);
+
+    ssize_t bytes = sendto(sockfd, &file_inf, sizeof(metadata_t), 0,
+                    (struct sockaddr*) server, sizeof(struct sockaddr_in));
+
+    if (bytes < 0 || !bytes) {
+        close(sockfd);
+        return false;
+    }
+
+    print_cmsg("Metadata sent");
+    print_sep();
+
+    return true;
+}
+
+size_t send_file_normal(int sockfd, struct sockaddr_in* server, int infd,
+    size_t bytes_to_read) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    segment_t data_msgs[GSO_SEGS_MAX];
+    segment_t ack_msg;
+    socklen_t addr_len;
+    size_t seg_size = sizeof(segment_t);
+
+    size_t total_bytes = 0;
+    off_t offset = 0;
+
+    /* 
+     * send bursts of segments within the server's receive window, 
+     * segmented by the kernel if it can do so
+     */
+    bool gso = enable_udp_gso(sockfd);
+    int batch = 1;
+
+    if (gso) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE,
+            "UDP GSO enabled, sending up to %d segments per burst",
+            GSO_SEGS_MAX);
+        print_cmsg(inf_msg_buf);
+        print_sep();
+    }
+
+    for (int sq = 0, count = 0; (size_t) offset < bytes_to_read; 
+            sq += count) {
+        for (count = 0; count < batch && (size_t) offset < bytes_to_read;
+                count++) {
+            ssize_t bytes = prepare_segment(infd, offset, 
+                                bytes_to_read - offset, sq + count, false,
+                                &data_msgs[count]);
+
+            if (bytes < 0) {
+                close(sockfd);
+                exit_cerr(__LINE__, "Reading input file failed");
+            }
+
+            offset += bytes;
+        }
+
+        uint64_t start = prof_start();
+        ssize_t bytes = send_segments(sockfd, server, data_msgs, count, &gso);
+        prof_end(PROF_SEND, start);
+
+        if (bytes < 0) {
+            close(sockfd);
+            exit_cerr(__LINE__, "Sending message failed");
+        }
+
+        for (int i = 0; i < count; i++) {
+            RFT_PROBE2(segment_sent, data_msgs[i].sq, 
+                data_msgs[i].payload_bytes);
+            print_sent_segment(&data_msgs[i]);
+        }
+
+        /* wait for the ACK of each segment in the burst from the server */
+        for (int i = 0; i < count; i++) {
+            print_cmsg("Waiting for an ACK");
+
+            addr_len = (socklen_t) sizeof(struct sockaddr_in);
+            ack_msg.type = ACK_SEG;
+            start = prof_start();
+            ssize_t ack_bytes = recvfrom(sockfd, &ack_msg, seg_size, 0,
+                                (struct sockaddr*) server, &addr_len);
+            prof_end(PROF_ACK_WAIT, start);
+
+            if (ack_bytes > 0)
+                RFT_PROBE2(ack_received, ack_msg.sq, ack_msg.type);
+
+            if (ack_bytes < 0) {
+                close(sockfd);
+                exit_cerr(__LINE__, "Reading ACK failed");
+            } else if (ack_msg.type == NACK_SEG) {
+                /* no resending in normal mode, it expects no corruption */
+                close(sockfd);
+                errno = EPROTO;
+                snprintf(inf_msg_buf, INF_MSG_SIZE,
+                    "Segment with sq: %d rejected by server", ack_msg.sq);
+                exit_cerr(__LINE__, inf_msg_buf);
+            } else if (!ack_bytes) {
+                close(sockfd);
+                exit_cerr(__LINE__, "No ACK received. Connection ending.");
+            } else {
+                snprintf(inf_msg_buf, INF_MSG_SIZE,
+                    "ACK with sq: %d received", ack_msg.sq);
+                print_cmsg(inf_msg_buf);
+                print_sep();
+            }
+
+            total_bytes += data_msgs[i].payload_bytes;
+
+            /* the window advertised in the last ACK sizes the next burst */
+            batch = ack_msg.payload_bytes;
+        }
+
+        if (batch < 1)
+            batch = 1;
+        else if (batch > GSO_SEGS_MAX)
+            batch = GSO_SEGS_MAX;
+    }
+
+    return total_bytes;
+}
+
+size_t send_file_with_timeout(int sockfd, struct sockaddr_in* server, int infd,
+    size_t bytes_to_read, float loss_prob) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    segment_t data_msg;
+    segment_t ack_msg;
+    socklen_t addr_len;
+    size_t seg_size = sizeof(segment_t);
+
+    /* set a timeout on receipt of ACKs */
+    struct timeval timeout;
+    timeout.tv_sec = ACK_TIMEOUT_SEC;
+    timeout.tv_usec = 0;
+
+    int r = setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                sizeof(struct timeval));
+    if (r < 0)
+        exit_cerr(__LINE__, "Unable to set socket");
+
+    size_t total_bytes = 0;
+    off_t offset = 0;
+
+    for (int sq = 0; (size_t) offset < bytes_to_read; sq++) {
+        bool corrupted = is_corrupted(loss_prob);
+        ssize_t read_bytes = prepare_segment(infd, offset, 
+                                bytes_to_read - offset, sq, corrupted,
+                                &data_msg);
+
+        if (read_bytes < 0) {
+            close(sockfd);
+            exit_cerr(__LINE__, "Reading input file failed");
+        }
+
+        offset += read_bytes;
+
+        uint64_t start = prof_start();
+        ssize_t bytes = sendto(sockfd, &data_msg, seg_size, 0,
+                        (struct sockaddr*) server, sizeof(struct sockaddr_in));
+        prof_end(PROF_SEND, start);
+        RFT_PROBE2(segment_sent, data_msg.sq, data_msg.payload_bytes);
+
+        if (bytes < 0) {
+            close(sockfd);
+            exit_cerr(__LINE__, "Sending message failed");
+        }
+
+        print_sent_segment(&data_msg);
+        print_cmsg("Waiting for an ACK");
+
+        /* wait for the ACK from the server, resending on timeout or NACK */
+        addr_len = (socklen_t) sizeof(struct sockaddr_in);
+        ssize_t ack_bytes;
+
+        for (;;) {
+            start = prof_start();
+            ack_bytes = recvfrom(sockfd, &ack_msg, seg_size, 0,
+                            (struct sockaddr*) server, &addr_len);
+            prof_end(PROF_ACK_WAIT, start);
+
+            if (!ack_bytes)
+                break;
+
+            if (ack_bytes > 0)
+                RFT_PROBE2(ack_received, ack_msg.sq, ack_msg.type);
+
+            /* ignore a late reply to an earlier copy of a segment */
+            if (ack_bytes > 0 && ack_msg.sq != data_msg.sq)
+                continue;
+
+            if (ack_bytes > 0 && ack_msg.type == ACK_SEG)
+                break;
+
+            if (ack_bytes > 0) {
+                snprintf(inf_msg_buf, INF_MSG_SIZE,
+                    "NACK with sq: %d received. Resending...", ack_msg.sq);
+                print_cmsg(inf_msg_buf);
+            } else {
+                print_cmsg("No ACK received in time. Resending...");
+            }
+
+            corrupted = is_corrupted(loss_prob);
+            start = prof_start();
+            data_msg.checksum = checksum(data_msg.payload, corrupted);
+            prof_end(PROF_CHECKSUM, start);
+
+            print_sent_segment(&data_msg);
+
+            start = prof_start();
+            bytes = sendto(sockfd, &data_msg, seg_size, 0,
+                    (struct sockaddr*) server, sizeof(struct sockaddr_in));
+            prof_end(PROF_SEND, start);
+            RFT_PROBE2(segment_sent, data_msg.sq, data_msg.payload_bytes);
+        }
+
+        if (!ack_bytes) {
+            close(sockfd);
+            exit_cerr(__LINE__, "No ACK received. Connection ended.");
+        } else {
+            snprintf(inf_msg_buf, INF_MSG_SIZE, "ACK with sq: %d received",
+                ack_msg.sq);
+            print_cmsg(inf_msg_buf);
+            print_sep();
+        }
+
+        total_bytes += data_msg.payload_bytes;
+    }
+
+    return total_bytes;
+}
+
+size_t send_file_fanout(int sockfd, struct sockaddr_in* servers, int nservers,
+    int infd, size_t bytes_to_read, float loss_prob, bool* dropped) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    segment_t data_msgs[GSO_SEGS_MAX];
+    segment_t ack_msg;
+    struct sockaddr_in from;
+    socklen_t addr_len;
+    size_t seg_size = sizeof(segment_t);
+
+    /* state of each segment of a burst at each server */
+    enum { TO_SEND, SENT, ACKED } state[FANOUT_MAX][GSO_SEGS_MAX];
+    size_t windows[FANOUT_MAX];
+
+    /* timeouts in a row of each server */
+    int timeouts[FANOUT_MAX] = { 0 };
+    int live = nservers;
+
+    for (int s = 0; s < nservers; s++)
+        dropped[s] = false;
+
+    /* set a timeout on receipt of ACKs */
+    struct timeval timeout;
+    timeout.tv_sec = ACK_TIMEOUT_SEC;
+    timeout.tv_usec = 0;
+
+    int r = setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                sizeof(struct timeval));
+    if (r < 0)
+        exit_cerr(__LINE__, "Unable to set socket");
+
+    bool gso = enable_udp_gso(sockfd);
+    size_t total_bytes = 0;
+    off_t offset = 0;
+    int batch = 1;
+
+    for (int sq = 0, count = 0; (size_t) offset < bytes_to_read;
+            sq += count) {
+        /* read the burst from the file once for all the servers */
+        for (count = 0; count < batch && (size_t) offset < bytes_to_read;
+                count++) {
+            ssize_t bytes = prepare_segment(infd, offset, 
+                                bytes_to_read - offset, sq + count, false,
+                                &data_msgs[count]);
+
+            if (bytes < 0) {
+                close(sockfd);
+                exit_cerr(__LINE__, "Reading input file failed");
+            }
+
+            offset += bytes;
+
+            print_sent_segment(&data_msgs[count]);
+        }
+
+        snprintf(inf_msg_buf, INF_MSG_SIZE,
+            "Burst of %d segments sent to %d servers", count, live);
+        print_cmsg(inf_msg_buf);
+        print_sep();
+
+        /* a dropped server needs nothing more */
+        for (int s = 0; s < nservers; s++) {
+            for (int i = 0; i < count; i++)
+                state[s][i] = dropped[s] ? ACKED : TO_SEND;
+        }
+
+        int unacked = live * count;
+        bool first = true;
+
+        while (unacked) {
+            /*
+             * send each segment to the servers that still need it: the whole
+             * burst the first time, then one repair round for all the NACKs
+             * (or timeouts) of the round before
+             */
+            int awaiting = 0;
+
+            for (int i = 0; i < count; i++) {
+                int repairs = 0;
+
+                for (int s = 0; s < nservers; s++) {
+                    if (state[s][i] != TO_SEND)
+                        continue;
+
+                    segment_t copy = data_msgs[i];
+                    uint64_t start = prof_start();
+                    copy.checksum = checksum(copy.payload,
+                                        is_corrupted(loss_prob));
+                    prof_end(PROF_CHECKSUM, start);
+
+                    /* an uncorrupted first burst is sent with GSO below */
+                    if (!first || loss_prob > 0.0) {
+                        start = prof_start();
+                        ssize_t bytes = sendto(sockfd, &copy, seg_size, 0,
+                                            (struct sockaddr*) &servers[s],
+                                            sizeof(struct sockaddr_in));
+                        prof_end(PROF_SEND, start);
+
+                        if (bytes < 0) {
+                            close(sockfd);
+                            exit_cerr(__LINE__, "Sending message failed");
+                        }
+
+                        RFT_PROBE2(segment_sent, copy.sq, copy.payload_bytes);
+                    }
+
+                    state[s][i] = SENT;
+                    awaiting++;
+                    repairs++;
+                }
+
+                if (!first && repairs) {
+                    snprintf(inf_msg_buf, INF_MSG_SIZE,
+                        "Repair of segment with sq: %d sent to %d servers",
+                        data_msgs[i].sq, repairs);
+                    print_cmsg(inf_msg_buf);
+                }
+            }
+
+            if (first && loss_prob <= 0.0) {
+                for (int s = 0; s < nservers; s++) {
+                    if (dropped[s])
+                        continue;
+
+                    uint64_t start = prof_start();
+                    ssize_t bytes = send_segments(sockfd, &servers[s],
+                                        data_msgs, count, &gso);
+                    prof_end(PROF_SEND, start);
+
+                    if (bytes < 0) {
+                        close(sockfd);
+                        exit_cerr(__LINE__, "Sending message failed");
+                    }
+
+                    for (int i = 0; i < count; i++)
+                        RFT_PROBE2(segment_sent, data_msgs[i].sq,
+                            data_msgs[i].payload_bytes);
+                }
+            }
+
+            first = false;
+            print_cmsg("Waiting for ACKs");
+
+            /* collect a reply to every segment sent in this round */
+            while (awaiting) {
+                addr_len = (socklen_t) sizeof(struct sockaddr_in);
+                uint64_t start = prof_start();
+                ssize_t ack_bytes = recvfrom(sockfd, &ack_msg, seg_size, 0,
+                                    (struct sockaddr*) &from, &addr_len);
+                prof_end(PROF_ACK_WAIT, start);
+
+                if (ack_bytes < 0) {
+                    /* 
+                     * repair whatever was not ACKed in time, dropping a 
+                     * server that has timed out too often so that it does
+                     * not hold up the others
+                     */
+                    print_cmsg("No ACKs received in time. Repairing...");
+
+                    for (int s = 0; s < nservers; s++) {
+                        bool timed_out = false;
+
+                        for (int i = 0; i < count; i++) {
+                            if (state[s][i] == SENT) {
+                                state[s][i] = TO_SEND;
+                                timed_out = true;
+                            }
+                        }
+
+                        if (timed_out && ++timeouts[s] == MAX_TIMEOUTS) {
+                            for (int i = 0; i < count; i++) {
+                                if (state[s][i] != ACKED)
+                                    unacked--;
+
+                                state[s][i] = ACKED;
+                            }
+
+                            dropped[s] = true;
+                            live--;
+
+                            snprintf(inf_msg_buf, INF_MSG_SIZE,
+                                "Server %s:%d dropped after %d timeouts",
+                                inet_ntoa(servers[s].sin_addr),
+                                ntohs(servers[s].sin_port), MAX_TIMEOUTS);
+                            print_cmsg(inf_msg_buf);
+                        }
+                    }
+
+                    if (!live) {
+                        close(sockfd);
+                        errno = ETIMEDOUT;
+                        exit_cerr(__LINE__, "No server left to send to");
+                    }
+
+                    break;
+                }
+
+                int s = 0;
+
+                while (s < nservers
+                        && (servers[s].sin_addr.s_addr != from.sin_addr.s_addr
+                        || servers[s].sin_port != from.sin_port))
+                    s++;
+
+                RFT_PROBE2(ack_received, ack_msg.sq, ack_msg.type);
+
+                int i = ack_msg.sq - sq;
+
+                /* ignore strangers and late replies to earlier rounds */
+                if (s == nservers || i < 0 || i >= count
+                        || state[s][i] != SENT)
+                    continue;
+
+                awaiting--;
+                timeouts[s] = 0;
+
+                if (ack_msg.type == ACK_SEG) {
+                    state[s][i] = ACKED;
+                    windows[s] = ack_msg.payload_bytes;
+                    unacked--;
+                } else {
+                    snprintf(inf_msg_buf, INF_MSG_SIZE,
+                        "NACK with sq: %d received from %s:%d", ack_msg.sq,
+                        inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+                    print_cmsg(inf_msg_buf);
+                    state[s][i] = TO_SEND;
+                }
+            }
+        }
+
+        snprintf(inf_msg_buf, INF_MSG_SIZE,
+            "ACKs of segments with sq: %d to %d received from %d servers",
+            sq, sq + count - 1, live);
+        print_cmsg(inf_msg_buf);
+        print_sep();
+
+        for (int i = 0; i < count; i++)
+            total_bytes += data_msgs[i].payload_bytes;
+
+        /* the next burst fits the smallest window of the servers */
+        batch = GSO_SEGS_MAX;
+
+        for (int s = 0; s < nservers; s++) {
+            if (!dropped[s] && (int) windows[s] < batch)
+                batch = windows[s];
+        }
+
+        if (batch < 1)
+            batch = 1;
+    }
+
+    return total_bytes;
+}
@@ -5,24 +5,16 @@
 #include <netinet/in.h> // for sockaddr_in
 
 /*
- * INTRODUCTION AND WHAT YOU HAVE TO DO
- * For Part 1 of the assignment, you have to implement the following 
- * functions declared and documented in this file:
+ * The functions used by rft_client to transfer a file, implemented in 
+ * rft_client_util.c:
  *      create_udp_socket
  *      send_metadata
- *      send_file_normal
+ *      send_file_normal (nm transfer mode)
+ *      send_file_with_timeout (wt transfer mode)
+ *      send_file_fanout (fo transfer mode)
  *
- * For Part 2 of the assignment, you have to implement the following function 
- * that is declared and documented in this file:
- *      send_file_with_timeout
- * 
- * Do not change any function signatures and do not change any other functions
- * or code provided.
- *
- * You complete implementation of the functions in: rft_client_util.c
- *
- * That is, you do not edit this file. You edit the functions listed above
- * in rft_client_util.c
+ * They print progress messages and exit the client on error. To embed
+ * transfers in another program use librft (rft_lib.h) instead.
  */
 
 /* 
@@ -46,8 +38,9 @@
 int create_udp_socket(struct sockaddr_in* server, char* server_addr, int port);
 
 /* 
- * send_metadata - send metadata (file size and file name to create) using 
- *      the given open socket to the server identified by the given sockaddr.
+ * send_metadata - send metadata (file size, file name to create and 
+ *      priority hint) using the given open socket to the server identified
+ *      by the given sockaddr.
  *  
  *      This function does NOT print any information or error messages.
  *      If sending metadata fails, this function closes open resources 
@@ -61,13 +54,15 @@ int create_udp_socket(struct sockaddr_in* server, char* server_addr, int port);
  * output_file - the name of the file that the server will create for output
  *      of the data to be sent by the client (it will be a copy of the client's
  *      file)
+ * priority - priority hint for the server to schedule the transfer with,
+ *      from 0 (bulk) to PRIO_MAX (urgent)
  *
  * Return:
  * True if the metadata was successfully sent, false otherwise (and the 
  *      the function closes open resources passed to it)
  */
 bool send_metadata(int sockfd, struct sockaddr_in* server, off_t file_size, 
-    char* output_file);
+    char* output_file, int priority);
     
 /* 
  * send_file_normal - send the file represented by the given open file 
@@ -86,6 +81,16 @@ bool send_metadata(int sockfd, struct sockaddr_in* server, off_t file_size,
  *      The main client function does not call send_file_normal if infd is
  *      empty.
  *
+ *      Holes and runs of zero bytes in the file are sent as a single zero
+ *      range segment each (see read_segment in rft_util.h) rather than as
+ *      chunks of zeros.
+ *
+ *      Segments are sent in bursts of as many segments as the receive window
+ *      advertised in the server's last ACK (at most GSO_SEGS_MAX, one for 
+ *      the first burst), and then the ACKs of the burst are collected in 
+ *      order. Where the kernel supports UDP GSO (Linux UDP_SEGMENT), a 
+ *      burst is passed to the kernel in one send.
+ *
  *      This function has the following side effects:
  *      - information messages printed for the user to follow progress of the
  *          file transfer
@@ -118,6 +123,7 @@ size_t send_file_normal(int sockfd, struct sockaddr_in* server, int infd,
  *      by the given sockaddr struct. The function returns the number of 
  *      bytes sent to the server.
  *      This function is essentially the same as the send_file_normal function
+ *      (including sending zero ranges for holes and runs of zero bytes)
  *      except that it resends data segments if no ACK for a segment is 
  *      received from the server. The function implements this as follows:
  *      (i) it simulates network corruption or loss of data segments by
@@ -125,11 +131,10 @@ size_t send_file_normal(int sockfd, struct sockaddr_in* server, int infd,
  *          of the is_corrupted and checksum functions provided). The 
  *          probability of loss/corruption is determined by the loss_prob
  *          parameter.
- *      (ii) it times out when waiting to receive an ACK from the server
- *          for a data segment. The server does not ACK corrupted segments.
- *          Therefore, this client function will timeout waiting for an ACK 
- *          for a corrupted segment. When the timeout expires, the 
- *          function resends the data segment.
+ *      (ii) it resends a data segment when the server sends a NACK for it 
+ *          (the server NACKs corrupted segments instead of ACKing them), or
+ *          when it times out waiting to receive an ACK from the server for
+ *          the segment because the segment or its ACK was lost.
  *
  *      The file is sent in chunks as payload to a succession of one or 
  *      more data segments. The number of segments required is determined 
@@ -170,6 +175,54 @@ size_t send_file_normal(int sockfd, struct sockaddr_in* server, int infd,
 size_t send_file_with_timeout(int sockfd, struct sockaddr_in* server, int infd, 
     size_t bytes_to_read, float loss_prob);
 
+/* 
+ * send_file_fanout - send the file represented by the given open file 
+ *      descriptor to each of the given servers, using the given open socket.
+ *      The function returns the number of bytes of the file sent (once, not
+ *      once per server).
+ *
+ *      The file is read once: each burst of segments (sized by the smallest
+ *      receive window advertised by the servers) is read from the file and
+ *      sent to every server, and the ACKs of all the servers are collected
+ *      before the next burst is read. Servers NACK corrupted segments. The
+ *      NACKs of a round are aggregated and each segment is repaired in one
+ *      round, from the burst in memory, to all the servers that need it.
+ *      Segments not ACKed or NACKed before a timeout are repaired the same
+ *      way. Corruption is simulated with the given loss probability, as for
+ *      send_file_with_timeout.
+ *
+ *      A server that times out MAX_TIMEOUTS (10) rounds in a row is dropped
+ *      from the transfer, and the file is sent to the others. The delivery
+ *      is then partial: the file is incomplete on the dropped servers,
+ *      which are flagged in dropped for the caller to report. The client 
+ *      exits with an error if every server has been dropped.
+ *
+ *      The metadata must have been sent to every server first.
+ *
+ *      This function has the same side effects as send_file_with_timeout.
+ *
+ * Parameters:
+ * sockfd - the socket file descriptor to use to send the file (created
+ *      by create_udp_socket)
+ * servers - the sockaddr structs of the servers (at most FANOUT_MAX)
+ * nservers - the number of servers
+ * infd - open file descriptor of the client's input file to send to the 
+ *      servers
+ * bytes_to_read - the number of bytes expected to be read form the file
+ *      (initialised to the file size)
+ * loss_prob - the probability of the loss or corruption of a segment sent
+ *      to a server
+ * dropped - set for each server (nservers entries) to whether it was 
+ *      dropped, that is whether it did not receive the whole file
+ *
+ * Return:
+ * On success: the number of bytes of the file sent to the servers that 
+ *      were not dropped
+ * On failure: the function causes exit of the client with an error message
+ */
+size_t send_file_fanout(int sockfd, struct sockaddr_in* servers, int nservers,
+    int infd, size_t bytes_to_read, float loss_prob, bool* dropped);
+
 /* 
  * Definition of utility function provided for you
  */
@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h> // for sockaddr_in
+#include <arpa/inet.h>
+#include "rft_util.h"
+#include "rft_lib.h"
+
+/*
+ * Implementation of librft, declared and documented in rft_lib.h
+ */
+
+/* a running transfer */
+typedef struct rft_transfer {
+    int id;                         // id returned by rft_submit
+    int infd;                       // open input file
+    struct sockaddr_in server;      // server the file is sent to
+    off_t size;                     // size of the file
+    off_t offset;                   // offset of the next chunk to send
+    segment_t data_msg;             // segment waiting for its ACK
+    size_t bytes;                   // bytes of the file ACKed so far
+    int retries;                    // resends of the current segment
+    struct timespec deadline;       // when to resend the current segment
+    rft_done_fn done;               // completion callback
+    void* arg;                      // argument to completion callback
+    struct rft_transfer* next;      // next running transfer of the context
+} rft_transfer_t;
+
+struct rft_ctx {
+    int sockfd;                     // socket shared by all transfers
+    int next_id;                    // id of the next submitted transfer
+    int running;                    // number of running transfers
+    rft_transfer_t* transfers;      // list of running transfers
+};
+
+static char* rft_err_s[] = {
+    "Success",
+    "Invalid argument",
+    "Out of memory",
+    "Socket error",
+    "Could not open or read input file",
+    "Sending to server failed",
+    "Transfer to server already running",
+    "No ACK received from server"
+};
+
+/* helper functions for timeouts */
+static void set_deadline(struct timespec* deadline, int ms);
+static int ms_until(struct timespec* deadline);
+
+/* helper functions to move a transfer on */
+static int send_segment(rft_ctx_t* ctx, rft_transfer_t* t);
+static int next_segment(rft_ctx_t* ctx, rft_transfer_t* t);
+static void finish(rft_ctx_t* ctx, rft_transfer_t* t, int status);
+
+/* helper functions for rft_poll */
+static rft_transfer_t* find_transfer(rft_ctx_t* ctx, struct sockaddr_in* addr);
+static void receive_acks(rft_ctx_t* ctx);
+static void resend_expired(rft_ctx_t* ctx);
+
+int rft_ctx_create(rft_ctx_t** ctx) {
+    if (!ctx)
+        return RFT_EINVAL;
+
+    rft_ctx_t* c = calloc(1, sizeof(rft_ctx_t));
+
+    if (!c)
+        return RFT_ENOMEM;
+
+    c->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (c->sockfd == -1) {
+        free(c);
+        return RFT_ESOCKET;
+    }
+
+    int flags = fcntl(c->sockfd, F_GETFL, 0);
+
+    if (flags < 0 || fcntl(c->sockfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        close(c->sockfd);
+        free(c);
+        return RFT_ESOCKET;
+    }
+
+    *ctx = c;
+
+    return RFT_OK;
+}
+
+void rft_ctx_destroy(rft_ctx_t* ctx) {
+    if (!ctx)
+        return;
+
+    rft_transfer_t* t = ctx->transfers;
+
+    while (t) {
+        rft_transfer_t* next = t->next;
+        close(t->infd);
+        free(t);
+        t = next;
+    }
+
+    close(ctx->sockfd);
+    free(ctx);
+}
+
+int rft_ctx_fd(rft_ctx_t* ctx) {
+    return ctx ? ctx->sockfd : RFT_EINVAL;
+}
+
+int rft_submit(rft_ctx_t* ctx, const char* input_file,
+    const char* output_file, const char* server_addr, int port, int priority,
+    rft_done_fn done, void* arg) {
+    if (!ctx || !input_file || !output_file || !server_addr)
+        return RFT_EINVAL;
+
+    if (strnlen(output_file, FILE_NAME_SIZE) == FILE_NAME_SIZE)
+        return RFT_EINVAL;
+
+    if (port < PORT_MIN || port > PORT_MAX)
+        return RFT_EINVAL;
+
+    if (priority < 0 || priority > PRIO_MAX)
+        return RFT_EINVAL;
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(struct sockaddr_in));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);  // convert to network byte order
+
+    if (inet_pton(AF_INET, server_addr, &server.sin_addr) != 1)
+        return RFT_EINVAL;
+
+    if (find_transfer(ctx, &server))
+        return RFT_EBUSY;
+
+    int infd = open(input_file, O_RDONLY);
+
+    if (infd < 0)
+        return RFT_EFILE;
+
+    struct stat sbuf;
+
+    if (fstat(infd, &sbuf) < 0) {
+        close(infd);
+        return RFT_EFILE;
+    }
+
+    rft_transfer_t* t = calloc(1, sizeof(rft_transfer_t));
+
+    if (!t) {
+        close(infd);
+        return RFT_ENOMEM;
+    }
+
+    t->id = ctx->next_id++;
+    t->infd = infd;
+    t->server = server;
+    t->done = done;
+    t->arg = arg;
+    t->size = sbuf.st_size;
+
+    /* Send meta data to the server */
+    metadata_t file_inf;
+    prepare_metadata(&file_inf, sbuf.st_size, output_file, priority);
+
+    ssize_t bytes = sendto(ctx->sockfd, &file_inf, sizeof(metadata_t), 0,
+                    (struct sockaddr*) &t->server, sizeof(struct sockaddr_in));
+
+    if (bytes <= 0) {
+        close(infd);
+        free(t);
+        return RFT_ESEND;
+    }
+
+    t->data_msg.sq = -1;
+
+    /*
+     * an empty file is complete once its metadata is sent, it is finished
+     * by the next rft_poll so that callbacks only ever run from rft_poll
+     */
+    if (t->size) {
+        int r = next_segment(ctx, t);
+
+        if (r != RFT_OK) {
+            close(infd);
+            free(t);
+            return r;
+        }
+    } else {
+        set_deadline(&t->deadline, 0);
+    }
+
+    t->next = ctx->transfers;
+    ctx->transfers = t;
+    ctx->running++;
+
+    return t->id;
+}
+
+int rft_poll(rft_ctx_t* ctx, int timeout_ms) {
+    if (!ctx)
+        return RFT_EINVAL;
+
+    if (!ctx->running)
+        return 0;
+
+    /* do not wait past the earliest resend deadline */
+    for (rft_transfer_t* t = ctx->transfers; t; t = t->next) {
+        int ms = ms_until(&t->deadline);
+
+        if (timeout_ms < 0 || ms < timeout_ms)
+            timeout_ms = ms;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = ctx->sockfd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int r = poll(&pfd, 1, timeout_ms);
+
+    if (r < 0 && errno != EINTR)
+        return RFT_ESOCKET;
+
+    if (r > 0)
+        receive_acks(ctx);
+
+    resend_expired(ctx);
+
+    return ctx->running;
+}
+
+const char* rft_strerror(int err) {
+    if (err > 0 || err < RFT_ETIMEDOUT)
+        return "Unknown error";
+
+    return rft_err_s[-err];
+}
+
+static void set_deadline(struct timespec* deadline, int ms) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (long) (ms % 1000) * 1000000;
+
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+static int ms_until(struct timespec* deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long ms = (deadline->tv_sec - now.tv_sec) * 1000
+                + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+
+    return ms < 0 ? 0 : (int) ms;
+}
+
+/*
+ * send_segment - (re)send the current segment of a transfer and set the
+ * deadline for its ACK. A full socket buffer is not an error, the segment
+ * is resent when the deadline expires.
+ */
+static int send_segment(rft_ctx_t* ctx, rft_transfer_t* t) {
+    ssize_t bytes = sendto(ctx->sockfd, &t->data_msg, sizeof(segment_t), 0,
+                    (struct sockaddr*) &t->server, sizeof(struct sockaddr_in));
+
+    if (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK
+            && errno != ENOBUFS)
+        return RFT_ESEND;
+
+    set_deadline(&t->deadline, RFT_ACK_TIMEOUT_MS);
+
+    return RFT_OK;
+}
+
+/*
+ * next_segment - read the next chunk of the file (or zero range) into the
+ * current segment of a transfer and send it
+ */
+static int next_segment(rft_ctx_t* ctx, rft_transfer_t* t) {
+    ssize_t bytes = prepare_segment(t->infd, t->offset, t->size - t->offset,
+                        t->data_msg.sq + 1, false, &t->data_msg);
+
+    if (bytes < 0)
+        return RFT_EFILE;
+
+    t->offset += bytes;
+    t->retries = 0;
+
+    return send_segment(ctx, t);
+}
+
+/*
+ * finish - remove a transfer from its context, release its resources and
+ * call its completion callback
+ */
+static void finish(rft_ctx_t* ctx, rft_transfer_t* t, int status) {
+    rft_transfer_t** p = &ctx->transfers;
+
+    while (*p != t)
+        p = &(*p)->next;
+
+    *p = t->next;
+    ctx->running--;
+
+    close(t->infd);
+
+    if (t->done)
+        t->done(t->id, status, t->bytes, t->arg);
+
+    free(t);
+}
+
+static rft_transfer_t* find_transfer(rft_ctx_t* ctx, struct sockaddr_in* addr) {
+    for (rft_transfer_t* t = ctx->transfers; t; t = t->next) {
+        if (t->server.sin_addr.s_addr == addr->sin_addr.s_addr
+                && t->server.sin_port == addr->sin_port)
+            return t;
+    }
+
+    return NULL;
+}
+
+/*
+ * receive_acks - read all ACKs waiting on the socket and move on the
+ * transfer each one is for
+ */
+static void receive_acks(rft_ctx_t* ctx) {
+    segment_t ack_msg;
+    struct sockaddr_in from;
+
+    for (;;) {
+        socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
+        ssize_t bytes = recvfrom(ctx->sockfd, &ack_msg, sizeof(segment_t), 0,
+                        (struct sockaddr*) &from, &addr_len);
+
+        if (bytes < 0)
+            return;
+
+        if (bytes != sizeof(segment_t))
+            continue;
+
+        rft_transfer_t* t = find_transfer(ctx, &from);
+
+        /* ignore replies from unknown servers and to earlier segments */
+        if (!t || !t->size || ack_msg.sq != t->data_msg.sq)
+            continue;
+
+        /* resend a rejected segment now rather than on timeout */
+        if (ack_msg.type == NACK_SEG) {
+            int r = t->retries++ == RFT_MAX_RETRIES ? RFT_ETIMEDOUT
+                        : send_segment(ctx, t);
+
+            if (r != RFT_OK)
+                finish(ctx, t, r);
+
+            continue;
+        }
+
+        if (ack_msg.type != ACK_SEG)
+            continue;
+
+        t->bytes += t->data_msg.payload_bytes;
+
+        if (t->data_msg.last) {
+            finish(ctx, t, RFT_OK);
+            continue;
+        }
+
+        int r = next_segment(ctx, t);
+
+        if (r != RFT_OK)
+            finish(ctx, t, r);
+    }
+}
+
+/*
+ * resend_expired - resend the current segment of transfers whose ACK
+ * deadline has passed, failing those that have run out of retries
+ */
+static void resend_expired(rft_ctx_t* ctx) {
+    rft_transfer_t* t = ctx->transfers;
+
+    while (t) {
+        rft_transfer_t* next = t->next;
+
+        if (!ms_until(&t->deadline)) {
+            if (!t->size) {
+                finish(ctx, t, RFT_OK);
+            } else if (t->retries++ == RFT_MAX_RETRIES) {
+                finish(ctx, t, RFT_ETIMEDOUT);
+            } else {
+                int r = send_segment(ctx, t);
+
+                if (r != RFT_OK)
+                    finish(ctx, t, r);
+            }
+        }
+
+        t = next;
+    }
+}
@@ -0,0 +1,141 @@
+#ifndef _RFT_LIB_H
+#define _RFT_LIB_H
+#include <stddef.h>
+
+/*
+ * librft - a client library for embedding RFT file transfers in another
+ * program. Unlike the functions in rft_client_util.h, the library never
+ * prints messages or exits the process: every function reports failure
+ * with one of the error codes below.
+ *
+ * A context owns one UDP socket that is shared by all the transfers
+ * submitted to it. Transfers are driven by calling rft_poll, either in a
+ * loop or from an existing event loop when the context's socket (see
+ * rft_ctx_fd) becomes readable. Each transfer sends its segments one at a
+ * time, resending a segment if its ACK does not arrive in time or is a 
+ * NACK, and calls its completion callback when it ends. Sending one
+ * segment at a time keeps a transfer within any receive window a server
+ * advertises (which is never less than one segment).
+ *
+ * The metadata and segments are prepared by the same functions 
+ * (prepare_metadata and prepare_segment in rft_util.h) as rft_client's.
+ * Only the sending loop differs: rft_client blocks, prints every segment
+ * and exits on error as the coursework requires, while the library never
+ * blocks outside rft_poll and reports errors as codes.
+ *
+ * librft.a exports only the rft_ functions declared here. The helpers it
+ * shares with rft_client (checksum, print_msg, ...) are local to the 
+ * library, so they cannot clash with symbols of the program it is linked
+ * into.
+ *
+ * ACKs only carry a sequence number, so they are matched to transfers by
+ * the server address they come from. A context therefore runs at most one
+ * transfer to the same server address and port at a time.
+ *
+ * Typical use:
+ *
+ *      rft_ctx_t* ctx;
+ *      rft_ctx_create(&ctx);
+ *      rft_submit(ctx, "a.txt", "a_copy.txt", "127.0.0.1", 20333, 0,
+ *          done, arg);
+ *      rft_submit(ctx, "b.txt", "b_copy.txt", "127.0.0.1", 20334, 3,
+ *          done, arg);
+ *      while (rft_poll(ctx, 100) > 0)
+ *          ;
+ *      rft_ctx_destroy(ctx);
+ */
+
+#define RFT_ACK_TIMEOUT_MS 2000 // ms to wait for an ACK before resending
+#define RFT_MAX_RETRIES 10      // resends of a segment before giving up
+
+/* error codes returned by library functions (always negative) */
+typedef enum {
+    RFT_OK = 0,             // success
+    RFT_EINVAL = -1,        // invalid argument
+    RFT_ENOMEM = -2,        // out of memory
+    RFT_ESOCKET = -3,       // socket could not be created or polled
+    RFT_EFILE = -4,         // input file could not be opened or read
+    RFT_ESEND = -5,         // sending to the server failed
+    RFT_EBUSY = -6,         // a transfer to the server is already running
+    RFT_ETIMEDOUT = -7      // no ACK from the server after all retries
+} rft_err;
+
+/* a library context: a shared socket and its set of running transfers */
+typedef struct rft_ctx rft_ctx_t;
+
+/*
+ * rft_done_fn - completion callback of a transfer, called from rft_poll
+ *
+ * Parameters:
+ * id - the id of the transfer (as returned by rft_submit)
+ * status - RFT_OK if the whole file was ACKed, an error code otherwise
+ * bytes - the number of bytes of the file ACKed by the server
+ * arg - the user argument given to rft_submit
+ */
+typedef void (*rft_done_fn)(int id, int status, size_t bytes, void* arg);
+
+/*
+ * rft_ctx_create - create a context with its own non-blocking UDP socket
+ *
+ * Parameters:
+ * ctx - set to the new context on success
+ *
+ * Return:
+ * RFT_OK on success, RFT_ENOMEM or RFT_ESOCKET otherwise
+ */
+int rft_ctx_create(rft_ctx_t** ctx);
+
+/*
+ * rft_ctx_destroy - close the context's socket and free it. Transfers
+ * still running are abandoned without calling their callbacks. Must not be
+ * called from a completion callback.
+ */
+void rft_ctx_destroy(rft_ctx_t* ctx);
+
+/*
+ * rft_ctx_fd - the socket of the context, for registration with an event
+ * loop (poll it for readability and call rft_poll with a zero timeout)
+ */
+int rft_ctx_fd(rft_ctx_t* ctx);
+
+/*
+ * rft_submit - start the transfer of a file to a server. The metadata and
+ * first data segment are sent immediately, the rest of the transfer
+ * progresses in rft_poll.
+ *
+ * Parameters:
+ * ctx - the context to run the transfer in
+ * input_file - the name of the file to send
+ * output_file - the name of the file for the server to create
+ * server_addr - the server IP address (e.g. 127.0.0.1)
+ * port - the port the server is listening on
+ * priority - the priority hint for the server, from 0 (bulk) to 3 (urgent)
+ * done - the completion callback (may be NULL)
+ * arg - user argument passed to the completion callback
+ *
+ * Return:
+ * On success: a non-negative transfer id
+ * On failure: a negative error code
+ */
+int rft_submit(rft_ctx_t* ctx, const char* input_file,
+    const char* output_file, const char* server_addr, int port, int priority,
+    rft_done_fn done, void* arg);
+
+/*
+ * rft_poll - wait up to timeout_ms for ACKs from servers and move the
+ * transfers of the context on: send next segments, resend timed out
+ * segments and complete finished or failed transfers (calling their
+ * callbacks). A timeout of 0 does not block, -1 waits for the next event.
+ *
+ * Return:
+ * On success: the number of transfers still running
+ * On failure: RFT_ESOCKET
+ */
+int rft_poll(rft_ctx_t* ctx, int timeout_ms);
+
+/*
+ * rft_strerror - a description of the given error code
+ */
+const char* rft_strerror(int err);
+
+#endif
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rft_util.h"
+#include "rft_prof.h"
+
+/*
+ * Implementation of the profiling functions declared and documented in
+ * rft_prof.h
+ */
+
+#define PROF_SUB_BITS 4     // log2 of PROF_SUB_BUCKETS
+#define PROF_BUCKETS ((64 - PROF_SUB_BITS + 1) * PROF_SUB_BUCKETS)
+                            // buckets to cover any 64 bit duration
+
+#ifdef CLOCK_MONOTONIC_RAW
+#define PROF_CLOCK CLOCK_MONOTONIC_RAW  // not slewed by NTP
+#else
+#define PROF_CLOCK CLOCK_MONOTONIC
+#endif
+
+/* histogram of the durations (ns) of a stage */
+typedef struct histogram {
+    uint64_t count;                 // number of durations recorded
+    uint64_t total;                 // sum of durations
+    uint64_t max;                   // longest duration
+    uint64_t buckets[PROF_BUCKETS]; // count of durations in each bucket
+} histogram_t;
+
+/* a stage for the trace file */
+typedef struct trace_event {
+    uint64_t start;                 // start of the stage (ns)
+    uint64_t dur;                   // duration of the stage (ns)
+    prof_stage stage;               // the stage
+} trace_event_t;
+
+static char* stage_s[] = { "read", "checksum", "send", "ack_wait", "recv",
+                            "write", "reply", "print" };
+
+static bool enabled;                // profiling is on
+static char* prof_role;             // CLIENT or SERVER
+static uint64_t origin;             // time profiling started (ns)
+static histogram_t hists[PROF_STAGES];
+static char* trace_file;            // name of trace file, NULL for none
+static trace_event_t* events;       // events for the trace file
+static size_t nevents;              // number of events recorded
+static size_t dropped;              // events not recorded, events was full
+
+/* helper functions for histogram buckets */
+static int bucket_index(uint64_t v);
+static uint64_t bucket_max(int index);
+static uint64_t percentile(histogram_t* h, double p);
+
+/* helper function to write the trace file */
+static void write_trace(void);
+
+void prof_init(char* role) {
+    char* env = getenv("RFT_PROF");
+
+    if (!env || !*env || !strcmp(env, "0"))
+        return;
+
+    prof_role = role;
+
+    if (strcmp(env, "1")) {
+        events = malloc(PROF_TRACE_MAX * sizeof(trace_event_t));
+
+        if (events)
+            trace_file = env;
+        else
+            print_err(role, __LINE__, "No memory for trace events");
+    }
+
+    enabled = true;
+    origin = prof_start();
+}
+
+uint64_t prof_start(void) {
+    if (!enabled)
+        return 0;
+
+    struct timespec now;
+    clock_gettime(PROF_CLOCK, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+void prof_end(prof_stage stage, uint64_t start) {
+    if (!enabled || !start)
+        return;
+
+    uint64_t dur = prof_start() - start;
+    histogram_t* h = &hists[stage];
+
+    if (dur > h->max)
+        h->max = dur;
+
+    h->count++;
+    h->total += dur;
+    h->buckets[bucket_index(dur)]++;
+
+    if (!trace_file)
+        return;
+
+    if (nevents == PROF_TRACE_MAX) {
+        dropped++;
+        return;
+    }
+
+    events[nevents].start = start - origin;
+    events[nevents].dur = dur;
+    events[nevents].stage = stage;
+    nevents++;
+}
+
+void prof_report(void) {
+    char inf_msg_buf[INF_MSG_SIZE];
+
+    if (!enabled)
+        return;
+
+    /* the report's own messages are not profiled */
+    enabled = false;
+
+    print_msg(prof_role, "Profile of transfer stages (times in us)");
+    snprintf(inf_msg_buf, INF_MSG_SIZE,
+        "%-9s %8s %9s %9s %9s %9s %9s %9s", "stage", "count", "mean",
+        "p50", "p90", "p99", "p99.9", "max");
+    print_msg(prof_role, inf_msg_buf);
+
+    for (int i = 0; i < PROF_STAGES; i++) {
+        histogram_t* h = &hists[i];
+
+        if (!h->count)
+            continue;
+
+        snprintf(inf_msg_buf, INF_MSG_SIZE,
+            "%-9s %8llu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f", stage_s[i],
+            (unsigned long long) h->count, h->total / 1e3 / h->count,
+            percentile(h, 0.5) / 1e3, percentile(h, 0.9) / 1e3,
+            percentile(h, 0.99) / 1e3, percentile(h, 0.999) / 1e3,
+            h->max / 1e3);
+        print_msg(prof_role, inf_msg_buf);
+    }
+
+    if (trace_file)
+        write_trace();
+
+    print_sep();
+    enabled = true;
+}
+
+/*
+ * bucket_index - the bucket of a duration. Durations below
+ * 2 * PROF_SUB_BUCKETS have a bucket each, above that each power of two is
+ * split into PROF_SUB_BUCKETS buckets.
+ */
+static int bucket_index(uint64_t v) {
+    if (v < 2 * PROF_SUB_BUCKETS)
+        return (int) v;
+
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - PROF_SUB_BITS;
+
+    return shift * PROF_SUB_BUCKETS + (int) (v >> shift);
+}
+
+/* bucket_max - the largest duration counted in a bucket */
+static uint64_t bucket_max(int index) {
+    if (index < 2 * PROF_SUB_BUCKETS)
+        return (uint64_t) index;
+
+    int shift = index / PROF_SUB_BUCKETS - 1;
+    uint64_t min = (uint64_t) (index - shift * PROF_SUB_BUCKETS) << shift;
+
+    return min + ((uint64_t) 1 << shift) - 1;
+}
+
+/*
+ * percentile - the duration that the fraction p of the durations of a
+ * histogram do not exceed (to within the width of its bucket)
+ */
+static uint64_t percentile(histogram_t* h, double p) {
+    uint64_t rank = (uint64_t) (p * h->count + 0.5);
+    uint64_t seen = 0;
+
+    if (!rank)
+        rank = 1;
+
+    for (int i = 0; i < PROF_BUCKETS; i++) {
+        seen += h->buckets[i];
+
+        if (seen >= rank)
+            return bucket_max(i) < h->max ? bucket_max(i) : h->max;
+    }
+
+    return h->max;
+}
+
+/*
+ * write_trace - write the events recorded so far to the trace file in the
+ * Chrome trace event format, as complete ("X") events in us
+ */
+static void write_trace(void) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    FILE* f = fopen(trace_file, "w");
+
+    if (!f) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Could not open trace file %s",
+            trace_file);
+        print_err(prof_role, __LINE__, inf_msg_buf);
+        return;
+    }
+
+    int pid = (int) getpid();
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+        "\"args\":{\"name\":\"%s\"}}", pid, prof_role);
+
+    for (size_t i = 0; i < nevents; i++) {
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+            "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+            stage_s[events[i].stage], prof_role, events[i].start / 1e3,
+            events[i].dur / 1e3, pid, pid);
+    }
+
+    fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+    if (fclose(f)) {
+        print_err(prof_role, __LINE__, "Could not write trace file");
+        return;
+    }
+
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "%zu trace events written to %s",
+        nevents, trace_file);
+    print_msg(prof_role, inf_msg_buf);
+
+    if (dropped) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE,
+            "%zu trace events dropped, more than %d recorded", dropped,
+            PROF_TRACE_MAX);
+        print_msg(prof_role, inf_msg_buf);
+    }
+}
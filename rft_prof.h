@@ -0,0 +1,89 @@
+#ifndef _RFT_PROF_H
+#define _RFT_PROF_H
+#include <stdint.h>
+
+/*
+ * Profiling of the stages of a transfer, for the client and the server.
+ *
+ * Profiling is off unless the RFT_PROF environment variable is set:
+ *
+ *      RFT_PROF=1          print a latency histogram of each stage
+ *      RFT_PROF=<file>     also write every stage as a Chrome trace event
+ *                          to file (load it in chrome://tracing or Perfetto)
+ *
+ * Stages are timed with CLOCK_MONOTONIC_RAW, which is read without a
+ * system call on Linux. Durations are counted in log-linear (HDR style)
+ * buckets, so a histogram is accurate to within 1/PROF_SUB_BUCKETS of each
+ * value whatever its magnitude. When profiling is off, timing a stage
+ * costs a function call and a branch.
+ */
+
+#define PROF_SUB_BUCKETS 16     // buckets per power of two of a histogram
+#define PROF_TRACE_MAX 65536    // max events kept for a trace file
+
+/* stages of a transfer */
+typedef enum {
+    PROF_READ,          // read a chunk of the input file (client)
+    PROF_CHECKSUM,      // calculate the checksum of a payload
+    PROF_SEND,          // send data segments (client)
+    PROF_ACK_WAIT,      // wait for an ACK or NACK (client)
+    PROF_RECV,          // read datagrams from the socket (server)
+    PROF_WRITE,         // write a payload to the output file, or flush 
+                        // and close it (server)
+    PROF_REPLY,         // send an ACK or NACK (server)
+    PROF_PRINT,         // print an information message or separator
+    PROF_STAGES         // number of stages
+} prof_stage;
+
+/*
+ * USDT probes (provider rft) for perf or bpftrace, built in when the
+ * systemtap sys/sdt.h header is available and a no-op otherwise. A probe
+ * that is not attached is a single nop instruction. Build with
+ * -DRFT_NO_USDT to leave them out.
+ *
+ *      bpftrace -e 'usdt:./rft_server:rft:data_received { @[arg1] = count(); }'
+ */
+#if !defined(RFT_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define RFT_USDT
+#endif
+#endif
+
+#ifdef RFT_USDT
+#define RFT_PROBE2(name, arg1, arg2) DTRACE_PROBE2(rft, name, arg1, arg2)
+#else
+#define RFT_PROBE2(name, arg1, arg2) do { } while (0)
+#endif
+
+/*
+ * prof_init - turn profiling on if requested by the RFT_PROF environment
+ * variable
+ *
+ * Parameters:
+ * role - the role (CLIENT or SERVER) to report profiles for
+ */
+void prof_init(char* role);
+
+/*
+ * prof_start - the time a stage starts
+ *
+ * Return:
+ * A timestamp in ns to pass to prof_end, 0 if profiling is off
+ */
+uint64_t prof_start(void);
+
+/*
+ * prof_end - record that a stage that started at start (from prof_start)
+ * has ended
+ */
+void prof_end(prof_stage stage, uint64_t start);
+
+/*
+ * prof_report - print count, mean, percentiles and max of each stage
+ * recorded so far and, if requested, (re)write the trace file with the
+ * events recorded so far. Does nothing if profiling is off.
+ */
+void prof_report(void);
+
+#endif
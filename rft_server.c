@@ -2,16 +2,20 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h> // for sockaddr_in
+#include <netinet/udp.h> // for UDP_GRO
 #include <stdlib.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
 #include "rft_util.h"
+#include "rft_prof.h"
 
 /*
  * This file contains the main function for the server.
- * Do NOT change anything in this file.
  * 
  * For a usage message for the server type:
  * 
@@ -21,26 +25,125 @@
  *
  * Or start server as:
  *      
- *      rft_server <port>
+ *      rft_server <port> [transfers [rate]]
  *
  * where port is a port for the server to listen on in the range 1025 to 65535
+ * transfers is the number of transfers to serve before exiting (default 1,
+ * 0 for no limit) and rate is the rate limit of a bulk (priority 0) transfer
+ * in bytes of segments per second (default 0, no limit)
+ *
+ * Transfers from different clients are served at the same time. Segments 
+ * received are queued per transfer and the queues are served by deficit
+ * round robin, so one transfer cannot starve the others of ACKs and disk
+ * writes. A rate limit is enforced by a token bucket per transfer: when it
+ * runs out of tokens its segments wait (and are not ACKed) until it has 
+ * tokens again, and the receive window advertised in its ACKs shrinks to 
+ * the segments its tokens allow. Each priority level of a transfer 
+ * doubles its round robin quantum, rate limit and bucket size.
+ *
+ * The receive window never exceeds the free space in a transfer's queue,
+ * so a client that keeps within it never has a segment dropped. A segment
+ * that arrives when the queue is full is dropped and NACKed.
+ */
+
+#define MAX_SESSIONS 64     // max transfers served at the same time
+#define SESSION_QUEUE_SIZE (2 * GSO_SEGS_MAX) 
+                            // max segments queued for a transfer
+
+/* a transfer from a client, identified by the client's address */
+typedef struct session {
+    bool active;                    // transfer is in progress
+    struct sockaddr_in client;      // address of the client
+    metadata_t file_inf;            // expected size and name of the file
+    FILE* out_file;                 // output file
+    bool first_seg;                 // no segment has been ACKed yet
+    int next_sq;                    // sq of the next segment to write
+    segment_t queue[SESSION_QUEUE_SIZE];    
+                                    // segments waiting to be processed
+    int head;                       // index of first segment in queue
+    int queued;                     // number of segments in queue
+    size_t deficit;                 // bytes it may process this round
+    double tokens;                  // bytes its rate limit allows now
+    struct timespec refilled;       // time tokens were last added
+} session_t;
+
+/* scheduler of the transfers the server is serving */
+typedef struct scheduler {
+    long rate;                      // rate limit of a bulk transfer
+    int transfers;                  // transfers to serve (0 for no limit)
+    int completed;                  // transfers completed
+    int next;                       // session to start next round at
+    session_t sessions[MAX_SESSIONS];
+} scheduler_t;
+
+/* 
+ * receive_datagrams - read all datagrams waiting on the socket, starting 
+ * a transfer for metadata from a new client and queuing the segments of 
+ * running transfers, splitting coalesced datagrams by the size the kernel
+ * reports for them if GRO is enabled (gro)
+ */
+static void receive_datagrams(int sockfd, scheduler_t* sched, bool gro);
+
+/* 
+ * queue_datagram - handle one datagram (len bytes at buf) from a client:
+ * start a transfer for metadata from a new client, end the transfer on an
+ * empty datagram or queue a segment of a running transfer
  */
+static void queue_datagram(int sockfd, scheduler_t* sched, 
+    struct sockaddr_in* client, char* buf, size_t len);
 
 /* 
- * receive_file - receive a file on the given socket from the given client 
- * with given file metadata (expected size and name to write output to)
+ * start_session - start a transfer from the given client with given file 
+ * metadata (expected size, name to write output to and priority)
  */
-static void receive_file(int sockfd, struct sockaddr_in* client, 
+static void start_session(scheduler_t* sched, struct sockaddr_in* client,
     metadata_t* file_inf);
 
+/* end_session - complete a transfer and close its output file */
+static void end_session(scheduler_t* sched, session_t* s);
+
+/* 
+ * serve_sessions - process queued segments of transfers by deficit round
+ * robin, within their rate limits, until all queues are empty or waiting
+ * for tokens
+ */
+static void serve_sessions(int sockfd, scheduler_t* sched);
+
+/* 
+ * token bucket functions: add tokens for time elapsed since last refill,
+ * the receive window to advertise to a transfer, and ms to wait until the
+ * first transfer that is waiting for tokens can be served (-1 for none)
+ */
+static void refill_tokens(session_t* s, long rate);
+static size_t ack_window(session_t* s, long rate);
+static int token_wait(scheduler_t* sched);
+
 /* 
- * process_data_msg - function used by receive_file to process a single data
- * segment and send ack to client and write payload to file
+ * process_data_msg - function used by serve_sessions to process a single 
+ * data segment of a transfer and send ack, advertising the given receive 
+ * window, to client and write payload to file. A corrupted or out of order
+ * segment, or one whose length its payload or the file cannot hold, is not
+ * written and a NACK is sent for it instead, a duplicate of a segment
+ * already written is ACKed again.
  * returns indication of whether still in receiving state (or last segment
  * has been received).
  */
-static bool process_data_msg(int sockfd, struct sockaddr_in* client, 
-    bool* first_seg, segment_t* data_msg, FILE* out_file);
+static bool process_data_msg(int sockfd, session_t* s, segment_t* data_msg,
+    size_t window);
+
+/* 
+ * send_reply - send an ACK or NACK (type) for segment sq to the client of 
+ * a transfer, advertising the given receive window. Returns bytes sent.
+ */
+static ssize_t send_reply(int sockfd, session_t* s, seg_type type, int sq,
+    size_t window);
+
+/* 
+ * enable_udp_gro - probe for UDP generic receive offload (Linux only) and,
+ * if available, enable it on the socket so that bursts of data segments 
+ * can be received as one coalesced datagram. Returns true if GRO is on.
+ */
+static bool enable_udp_gro(int sockfd);
 
 /* 
  * Functions for information and error messages.
@@ -53,8 +156,12 @@ static void exit_serr(int line, char* msg); // exit server with error message
 int main(int argc,char *argv[]) {
     /* user needs to enter the port number */
     if (argc < 2) {
-        printf("usage: %s <port>\n", argv[0]);
+        printf("usage: %s <port> [transfers [rate]]\n", argv[0]);
         printf("       port is a number between 1025 and 65535\n");
+        printf("       transfers is the number of transfers to serve\n");
+        printf("          before exiting (default 1, 0 for no limit)\n");
+        printf("       rate is the rate limit of a bulk transfer in\n");
+        printf("          bytes per second (default 0, no limit)\n");
         exit(EXIT_FAILURE);
     }
     
@@ -63,6 +170,17 @@ int main(int argc,char *argv[]) {
     if (port < PORT_MIN || port > PORT_MAX) 
         exit_serr(__LINE__, "Port is outside valid range");
     
+    prof_init("SERVER");
+    
+    static scheduler_t sched;
+    sched.transfers = argc > 2 ? atoi(argv[2]) : 1;
+    sched.rate = argc > 3 ? atol(argv[3]) : 0;
+    
+    if (sched.transfers < 0 || sched.rate < 0) {
+        errno = EINVAL;
+        exit_serr(__LINE__, "Transfers and rate must not be negative");
+    }
+    
     /* create a socket */
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     
@@ -74,10 +192,8 @@ int main(int argc,char *argv[]) {
  
     /* set up address structures */
     struct sockaddr_in server;
-    struct sockaddr_in client;
     socklen_t sock_len = (socklen_t) sizeof(struct sockaddr_in); 
     memset(&server, 0, sock_len);
-    memset(&client, 0, sock_len);
     
     /* Fill in the server address structure */
     server.sin_family = AF_INET;
@@ -90,112 +206,425 @@ int main(int argc,char *argv[]) {
         exit_serr(__LINE__, "Bind failed");
     }
     
-    print_smsg("Bind success ... "
-                        "Ready to receive meta data from client"); 
-    print_sep();
-    print_sep();
-      
-    metadata_t file_inf;
-    socklen_t addr_len = sock_len;
-    ssize_t bytes = -1;
-
-    //receive from the client    
-    bytes = recvfrom(sockfd, &file_inf, sizeof(metadata_t), 0, 
-                    (struct sockaddr*) &client, &addr_len);
-    if (bytes < 0 ) {
-        close(sockfd);
-        exit_serr(__LINE__, "Reading stream message error");
-    } else if (!bytes) {
-        errno = ENOMSG;
-        exit_serr(__LINE__, "Ending connection - no metadata received");
-    } else {
-        print_smsg("Meta data received successfully");
-        char inf_msg_buf[INF_MSG_SIZE];              
+    /* 
+     * enable GRO before any data can arrive so that the client's first 
+     * burst is already coalesced
+     */
+    bool gro = enable_udp_gro(sockfd);
+    
+    if (gro)
+        print_smsg("UDP GRO enabled, receiving coalesced segments");
+    
+    if (sched.rate) {
+        char inf_msg_buf[INF_MSG_SIZE];
         snprintf(inf_msg_buf, INF_MSG_SIZE, 
-            "Output file name: %s, expected file size: %ld", file_inf.name, 
-            (long) file_inf.size);
+            "Rate limit of bulk transfers: %ld bytes per second", sched.rate);
         print_smsg(inf_msg_buf);
     }
     
+    print_smsg("Bind success ... "
+                        "Ready to receive meta data from client"); 
     print_sep();
     print_sep();
-    print_smsg("Waiting for the file ..."); 
     
-    receive_file(sockfd, &client, &file_inf);
+    /* serve transfers until enough have completed */
+    while (!sched.transfers || sched.completed < sched.transfers) {
+        struct pollfd pfd;
+        pfd.fd = sockfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        
+        /* wake up when a transfer waiting for tokens can be served */
+        int r = poll(&pfd, 1, token_wait(&sched));
+        
+        if (r < 0 && errno != EINTR) {
+            close(sockfd);
+            exit_serr(__LINE__, "Polling socket error");
+        }
+        
+        if (r > 0)
+            receive_datagrams(sockfd, &sched, gro);
+            
+        serve_sessions(sockfd, &sched);
+    }
     
     close(sockfd);
+
+    return EXIT_SUCCESS;
+}
+
+static void receive_datagrams(int sockfd, scheduler_t* sched, bool gro) {
+    static segment_t data_msgs[GRO_BUF_SIZE / sizeof(segment_t)];
+    size_t seg_size = sizeof(segment_t);
     
-    struct stat stat_buf;
-    stat(file_inf.name, &stat_buf);
-    char inf_msg_buf[INF_MSG_SIZE];
-    snprintf(inf_msg_buf, INF_MSG_SIZE, "%ld bytes written to file %s",
-        (long) stat_buf.st_size, file_inf.name);
-        
-    print_smsg(inf_msg_buf);
-    print_sep();
-    print_sep();
+    /* with GRO a burst of datagrams can arrive as one coalesced datagram */
+    size_t buf_size = gro ? sizeof(data_msgs) : seg_size;
+    
+    /* metadata is larger than a segment */
+    if (buf_size < sizeof(metadata_t))
+        buf_size = sizeof(metadata_t);
     
+    for (;;) {
+        struct sockaddr_in client;
+        char ctrl[CMSG_SPACE(sizeof(int))];
+        struct iovec iov;
+        struct msghdr msg;
+        
+        iov.iov_base = data_msgs;
+        iov.iov_len = buf_size;
+        memset(&msg, 0, sizeof(struct msghdr));
+        msg.msg_name = &client;
+        msg.msg_namelen = (socklen_t) sizeof(struct sockaddr_in);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        
+        uint64_t start = prof_start();
+        ssize_t bytes = recvmsg(sockfd, &msg, MSG_DONTWAIT);
+        
+        if (bytes >= 0)
+            prof_end(PROF_RECV, start);
+        
+        if (bytes < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return;
+            
+            close(sockfd);
+            exit_serr(__LINE__, "Reading stream message error");
+        }
+        
+        /* 
+         * a coalesced datagram is a run of datagrams of the size given by
+         * the UDP_GRO message, except the last which may be shorter. The 
+         * first may be metadata followed by the first segments.
+         */
+        size_t dgram_size = (size_t) bytes;
+        
+#ifdef UDP_GRO
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; 
+                c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+                int gso_size;
+                memcpy(&gso_size, CMSG_DATA(c), sizeof(int));
+                
+                if (gso_size > 0)
+                    dgram_size = (size_t) gso_size;
+            }
+        }
+#endif
+        
+        size_t offset = 0;
+        
+        do {
+            size_t len = bytes - offset < dgram_size ? bytes - offset 
+                            : dgram_size;
+            
+            queue_datagram(sockfd, sched, &client, 
+                (char*) data_msgs + offset, len);
+            offset += len;
+        } while (offset < (size_t) bytes);
+    }
+}
 
-    return EXIT_SUCCESS;
+static void queue_datagram(int sockfd, scheduler_t* sched, 
+    struct sockaddr_in* client, char* buf, size_t len) {
+    session_t* s = NULL;
+    
+    for (int i = 0; i < MAX_SESSIONS && !s; i++) {
+        session_t* c = &sched->sessions[i];
+        
+        if (c->active 
+                && c->client.sin_addr.s_addr == client->sin_addr.s_addr
+                && c->client.sin_port == client->sin_port)
+            s = c;
+    }
+    
+    if (!s) {
+        /* ignore stray segments from clients without a transfer */
+        if (len == sizeof(metadata_t)) {
+            metadata_t file_inf;
+            memcpy(&file_inf, buf, sizeof(metadata_t));
+            start_session(sched, client, &file_inf);
+        }
+        
+        return;
+    }
+    
+    if (!len) {
+        print_smsg("Ending connection");
+        end_session(sched, s);
+        return;
+    }
+    
+    /* a short datagram is zero filled, so that its payload is terminated */
+    segment_t data_msg;
+    memset(&data_msg, 0, sizeof(segment_t));
+    memcpy(&data_msg, buf, len < sizeof(segment_t) ? len : sizeof(segment_t));
+    
+    /* 
+     * a resend of a segment still waiting in the queue (its ACK held back
+     * by the rate limit) replaces the waiting copy, so it is written once 
+     * and takes no more tokens
+     */
+    int j = 0;
+    
+    while (j < s->queued && data_msg.sq 
+            != s->queue[(s->head + j) % SESSION_QUEUE_SIZE].sq)
+        j++;
+    
+    if (j < s->queued) {
+        s->queue[(s->head + j) % SESSION_QUEUE_SIZE] = data_msg;
+        return;
+    }
+    
+    /* 
+     * a client within the receive window of its ACKs never fills the 
+     * queue, one that does not is told to resend
+     */
+    if (s->queued == SESSION_QUEUE_SIZE) {
+        print_smsg("Transfer queue full, segment dropped");
+        send_reply(sockfd, s, NACK_SEG, data_msg.sq, 
+            ack_window(s, sched->rate));
+        return;
+    }
+    
+    int tail = (s->head + s->queued) % SESSION_QUEUE_SIZE;
+    s->queue[tail] = data_msg;
+    s->queued++;
 }
 
-static void receive_file(int sockfd, struct sockaddr_in* client, 
+static void start_session(scheduler_t* sched, struct sockaddr_in* client,
     metadata_t* file_inf) {
-    socklen_t addr_len = (socklen_t) sizeof(struct sockaddr_in);
-    segment_t data_msg;
+    char inf_msg_buf[INF_MSG_SIZE];
+    session_t* s = NULL;
+    
+    for (int i = 0; i < MAX_SESSIONS && !s; i++) {
+        if (!sched->sessions[i].active)
+            s = &sched->sessions[i];
+    }
+    
+    if (!s) {
+        errno = EBUSY;
+        print_serr(__LINE__, "Too many transfers, meta data ignored");
+        return;
+    }
+    
+    /* the name is a string and priority within range whatever was sent */
+    file_inf->name[FILE_NAME_SIZE - 1] = '\0';
+    
+    if (file_inf->priority < 0)
+        file_inf->priority = 0;
+    else if (file_inf->priority > PRIO_MAX)
+        file_inf->priority = PRIO_MAX;
         
-      
+    print_smsg("Meta data received successfully");
+    snprintf(inf_msg_buf, INF_MSG_SIZE, 
+        "Output file name: %s, expected file size: %ld, priority: %d", 
+        file_inf->name, (long) file_inf->size, file_inf->priority);
+    print_smsg(inf_msg_buf);
+    
+    print_sep();
+    print_sep();
+    print_smsg("Waiting for the file ..."); 
+    
+    memset(s, 0, sizeof(session_t));
+    s->client = *client;
+    s->file_inf = *file_inf;
+    s->first_seg = true;
+    
     /* Open the output file */
-    FILE* out_file = fopen(file_inf->name, "w");
+    s->out_file = fopen(file_inf->name, "w");
+    
+    if (!s->out_file) {
+        print_serr(__LINE__, "Could not open output file");
+        return;
+    }
+    
+    s->active = true;
+    
+    /* start with a full bucket */
+    s->tokens = (double) (GSO_SEGS_MAX * sizeof(segment_t)) 
+                    * (1 << file_inf->priority);
+    clock_gettime(CLOCK_MONOTONIC, &s->refilled);
     
-    if (!out_file) 
-        exit_serr(__LINE__, "Could not open output file");
-        
     // don't wait for empty file
     if (!file_inf->size) {
-        fclose(out_file);
+        end_session(sched, s);
         return;
     }
                 
     print_sep();
     print_sep();
+}
+
+static void end_session(scheduler_t* sched, session_t* s) {
+    char inf_msg_buf[INF_MSG_SIZE];
     
-    bool receiving = true;
-    bool first_seg = true;
-    size_t seg_size = sizeof(segment_t);
+    /* writes are buffered, most of the output file is written here */
+    uint64_t start = prof_start();
+    
+    if (s->file_inf.size) {
+        /* extend the file over a trailing zero range */
+        fflush(s->out_file);
+        
+        if (ftruncate(fileno(s->out_file), ftello(s->out_file)))
+            print_serr(__LINE__, "Could not set output file size");
+    }
+    
+    fclose(s->out_file);
+    prof_end(PROF_WRITE, start);
+    
+    if (s->file_inf.size) {
+        print_smsg("File copying complete");
+        print_sep();
+    }
+    
+    s->active = false;
+    s->queued = 0;
+    sched->completed++;
+    
+    struct stat stat_buf;
+    stat(s->file_inf.name, &stat_buf);
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "%ld bytes written to file %s",
+        (long) stat_buf.st_size, s->file_inf.name);
+        
+    print_smsg(inf_msg_buf);
+    print_sep();
+    print_sep();
+    
+    /* profile of all the transfers served so far */
+    prof_report();
+}
 
-    /* while still receiving segments */
-    while (receiving) {
-        memset(&data_msg, 0, seg_size);
-        ssize_t bytes = recvfrom(sockfd, &data_msg, seg_size, 0,
-                        (struct sockaddr*) client, &addr_len);
+static void serve_sessions(int sockfd, scheduler_t* sched) {
+    size_t seg_size = sizeof(segment_t);
+    bool served = true;
+    
+    /* rounds of deficit round robin while any segment can be processed */
+    while (served) {
+        served = false;
         
-        if (bytes < 0) {
-            fclose(out_file);
-            exit_serr(__LINE__, "Reading stream message error");
-        } else if (!bytes) {
-            print_smsg("Ending connection");
-            receiving = false;
-        } else {
-            receiving = process_data_msg(sockfd, client, &first_seg, &data_msg,                 
-                            out_file);
+        for (int i = 0; i < MAX_SESSIONS; i++) {
+            session_t* s = &sched->sessions[(sched->next + i) % MAX_SESSIONS];
+            
+            if (!s->active || !s->queued)
+                continue;
+                
+            size_t quantum = seg_size << s->file_inf.priority;
+            s->deficit += quantum;
+            refill_tokens(s, sched->rate);
+            
+            while (s->active && s->queued && s->deficit >= seg_size
+                    && (!sched->rate || s->tokens >= seg_size)) {
+                segment_t* data_msg = &s->queue[s->head];
+                s->head = (s->head + 1) % SESSION_QUEUE_SIZE;
+                s->queued--;
+                s->deficit -= seg_size;
+                
+                if (sched->rate)
+                    s->tokens -= seg_size;
+                    
+                served = true;
+                
+                if (!process_data_msg(sockfd, s, data_msg, 
+                        ack_window(s, sched->rate)))
+                    end_session(sched, s);
+            }
+            
+            /* 
+             * an idle transfer keeps no deficit, and one waiting for tokens
+             * does not save up more than a round's worth
+             */
+            if (!s->queued)
+                s->deficit = 0;
+            else if (s->deficit > quantum)
+                s->deficit = quantum;
         }
+        
+        sched->next = (sched->next + 1) % MAX_SESSIONS;
     }
+}
+
+static void refill_tokens(session_t* s, long rate) {
+    if (!rate)
+        return;
+        
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
     
-    print_smsg("File copying complete");
+    double elapsed = (now.tv_sec - s->refilled.tv_sec) 
+                        + (now.tv_nsec - s->refilled.tv_nsec) / 1e9;
+    double size = (double) (GSO_SEGS_MAX * sizeof(segment_t)) 
+                        * (1 << s->file_inf.priority);
     
-    print_sep();
+    s->tokens += elapsed * rate * (1 << s->file_inf.priority);
     
-    fclose(out_file);
+    if (s->tokens > size)
+        s->tokens = size;
+        
+    s->refilled = now;
+}
+
+static size_t ack_window(session_t* s, long rate) {
+    size_t window = SESSION_QUEUE_SIZE - s->queued;
+    
+    if (rate) {
+        size_t allowed = (size_t) (s->tokens / sizeof(segment_t));
+        
+        if (allowed < window)
+            window = allowed;
+    }
+    
+    if (window > GSO_SEGS_MAX)
+        window = GSO_SEGS_MAX;
+        
+    return window ? window : 1;
 }
 
-static bool process_data_msg(int sockfd, struct sockaddr_in* client, 
-    bool* first_seg, segment_t* data_msg, FILE* out_file) {
+static int token_wait(scheduler_t* sched) {
+    int wait = -1;
+    
+    if (!sched->rate)
+        return wait;
+        
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        session_t* s = &sched->sessions[i];
+        
+        if (!s->active || !s->queued)
+            continue;
+            
+        refill_tokens(s, sched->rate);
+        
+        double needed = sizeof(segment_t) - s->tokens;
+        int ms = needed <= 0 ? 0 : (int) (needed * 1000 
+                    / (sched->rate * (1 << s->file_inf.priority))) + 1;
+        
+        if (wait < 0 || ms < wait)
+            wait = ms;
+    }
+    
+    return wait;
+}
+
+static bool enable_udp_gro(int sockfd) {
+#ifdef UDP_GRO
+    int on = 1;
+    
+    return !setsockopt(sockfd, IPPROTO_UDP, UDP_GRO, &on, sizeof(int));
+#else
+    return false;
+#endif
+}
+
+static bool process_data_msg(int sockfd, session_t* s, segment_t* data_msg,
+    size_t window) {
     bool receiving = true;
     char inf_msg_buf[INF_MSG_SIZE];
-    size_t seg_size = sizeof(segment_t);
 
-    if (*first_seg) {
+    RFT_PROBE2(data_received, data_msg->sq, data_msg->payload_bytes);
+
+    if (s->first_seg) {
         /* first segment to be received */
         print_smsg("File transfer started"); 
         print_sep();
@@ -206,55 +635,105 @@ static bool process_data_msg(int sockfd, struct sockaddr_in* client,
         data_msg->sq, data_msg->payload_bytes, data_msg->checksum);
     print_smsg(inf_msg_buf);
     
+    /* a resent segment that was already written, its ACK was lost */
+    if (data_msg->sq < s->next_sq) {
+        print_smsg("Duplicate segment, not written");
+        send_reply(sockfd, s, ACK_SEG, data_msg->sq, window);
+        print_sep();
+        return receiving;
+    }
+    
+    /* a segment after one that is missing, it is resent after that one */
+    if (data_msg->sq > s->next_sq) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Segment out of order, expected sq: %d", s->next_sq);
+        print_smsg(inf_msg_buf);
+        send_reply(sockfd, s, NACK_SEG, data_msg->sq, window);
+        print_sep();
+        return receiving;
+    }
+    
     if (data_msg->payload[PAYLOAD_SIZE - 1]) {
         print_smsg("Payload not terminated");
-        print_smsg("Did NOT send any ACK");
+        send_reply(sockfd, s, NACK_SEG, data_msg->sq, window);
+        print_sep();
+        return receiving;
+    }
+    
+    /* 
+     * payload_bytes comes from the network: a data segment cannot hold 
+     * more than its payload and no segment may run past the end of the 
+     * file given in the metadata
+     */
+    off_t room = s->file_inf.size - ftello(s->out_file);
+    
+    if ((data_msg->type != DATA_SEG && data_msg->type != ZERO_SEG)
+            || (data_msg->type == DATA_SEG 
+            && data_msg->payload_bytes > PAYLOAD_SIZE - 1)
+            || room < 0 || data_msg->payload_bytes > (size_t) room) {
+        snprintf(inf_msg_buf, INF_MSG_SIZE, 
+            "Segment length %zu invalid, %ld bytes of file left", 
+            data_msg->payload_bytes, (long) room);
+        print_smsg(inf_msg_buf);
+        send_reply(sockfd, s, NACK_SEG, data_msg->sq, window);
         print_sep();
         return receiving;
     }
 
-    snprintf(inf_msg_buf, INF_MSG_SIZE, "Received payload:\n%s",
-        data_msg->payload);
+    if (data_msg->type == ZERO_SEG)
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Received zero range of %zu bytes",
+            data_msg->payload_bytes);
+    else
+        snprintf(inf_msg_buf, INF_MSG_SIZE, "Received payload:\n%s",
+            data_msg->payload);
     print_smsg(inf_msg_buf);
     print_sep();
 
+    uint64_t start = prof_start();
     int cs = checksum(data_msg->payload, false);
+    prof_end(PROF_CHECKSUM, start);
 
     /* 
      * If the calculated checksum is same as that of recieved 
      * checksum then send corrosponding ack
      */
     if (cs == data_msg->checksum) {
-        /* is it the last segment or will we still be receiving*/
-        receiving = !data_msg->last;
-         
         snprintf(inf_msg_buf, INF_MSG_SIZE, "Calculated checksum %d VALID",
             cs);
         print_smsg(inf_msg_buf);
     
-        /* Prepare the Ack segment */
-        segment_t ack_msg;
-        memset(&ack_msg, 0, seg_size);
-        ack_msg.sq = data_msg->sq;
-        ack_msg.type= ACK_SEG;
-    
-        snprintf(inf_msg_buf, INF_MSG_SIZE, "Sending ACK with sq: %d",
-            ack_msg.sq);
-        print_smsg(inf_msg_buf);
-    
         /* Send the Ack segment */
-        ssize_t bytes = sendto(sockfd, &ack_msg, seg_size, 0,
-                    (struct sockaddr*) client, sizeof(struct sockaddr_in));
+        ssize_t bytes = send_reply(sockfd, s, ACK_SEG, data_msg->sq, window);
                     
         if (bytes < 0) {
             print_serr(__LINE__, "Sending stream message error");
         } else if (!bytes) {
             print_smsg("Ending connection");
         } else {
-            /* write the payload of the data segment to output file */
-            fprintf(out_file, "%s", data_msg->payload);
+            /* 
+             * write the payload of the data segment to output file, or 
+             * skip over a zero range, leaving a hole in the file
+             */
+            start = prof_start();
+            
+            if (data_msg->type == ZERO_SEG)
+                fseeko(s->out_file, (off_t) data_msg->payload_bytes, 
+                    SEEK_CUR);
+            else
+                fwrite(data_msg->payload, 1, data_msg->payload_bytes, 
+                    s->out_file);
+            
+            prof_end(PROF_WRITE, start);
+            RFT_PROBE2(data_written, data_msg->sq, data_msg->payload_bytes);
+                    
+            uint64_t printed = prof_start();
             printf("        >>>> NETWORK: ACK sent successfully <<<<\n");
-            *first_seg = false;
+            prof_end(PROF_PRINT, printed);
+            s->first_seg = false;
+            s->next_sq++;
+            
+            /* is it the last segment or will we still be receiving*/
+            receiving = !data_msg->last;
         }
      
         print_sep();
@@ -263,13 +742,38 @@ static bool process_data_msg(int sockfd, struct sockaddr_in* client,
         snprintf(inf_msg_buf, INF_MSG_SIZE, "Segment checksum %d INVALID",
             cs);
         print_smsg(inf_msg_buf);
-        print_smsg("Did NOT send any ACK");
+        send_reply(sockfd, s, NACK_SEG, data_msg->sq, window);
         print_sep();
     }    
     
     return receiving;
 }
 
+static ssize_t send_reply(int sockfd, session_t* s, seg_type type, int sq,
+    size_t window) {
+    char inf_msg_buf[INF_MSG_SIZE];
+    size_t seg_size = sizeof(segment_t);
+    
+    /* Prepare the Ack segment */
+    segment_t ack_msg;
+    memset(&ack_msg, 0, seg_size);
+    ack_msg.sq = sq;
+    ack_msg.type = type;
+    ack_msg.payload_bytes = window;
+
+    snprintf(inf_msg_buf, INF_MSG_SIZE, "Sending %s with sq: %d",
+        type == ACK_SEG ? "ACK" : "NACK", ack_msg.sq);
+    print_smsg(inf_msg_buf);
+
+    uint64_t start = prof_start();
+    ssize_t bytes = sendto(sockfd, &ack_msg, seg_size, 0,
+                        (struct sockaddr*) &s->client, 
+                        sizeof(struct sockaddr_in));
+    prof_end(PROF_REPLY, start);
+
+    return bytes;
+}
+
 static void print_smsg(char* msg) {
     print_msg("SERVER", msg);
 }
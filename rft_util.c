@@ -2,10 +2,15 @@
 #include <string.h>
 #include <errno.h>
 #include "rft_util.h"
+#include "rft_prof.h"
 #include <stdlib.h>
+#include <stdint.h>
 
 
-/* Utility functions - do NOT edit this file */
+/* 
+ * Utility functions shared by the client, the server and librft, declared
+ * and documented in rft_util.h
+ */
 
 int checksum(char* payload, bool is_corrupted) {
     if (is_corrupted)
@@ -19,13 +24,152 @@ int checksum(char* payload, bool is_corrupted) {
     return sum;
 }
 
+/* number of leading zero bytes in buf, tested 64 bytes at a time */
+static size_t zero_bytes(const uint64_t* buf, size_t len) {
+    const size_t block = 8;     // words ORed together per test
+    size_t words = len / sizeof(uint64_t);
+    size_t i = 0;
+    
+    for (; i + block <= words; i += block) {
+        uint64_t acc = 0;
+        
+        for (size_t j = 0; j < block; j++)
+            acc |= buf[i + j];
+            
+        if (acc)
+            break;
+    }
+    
+    for (; i < words && !buf[i]; i++)
+        ;
+    
+    const char* bytes = (const char*) buf;
+    size_t n = i * sizeof(uint64_t);
+    
+    for (; n < len && !bytes[n]; n++)
+        ;
+        
+    return n;
+}
+
+/* 
+ * length of the run of zero bytes at offset in the file, up to max bytes,
+ * skipping holes without reading them where the system supports SEEK_DATA
+ */
+static size_t zero_run(int fd, off_t offset, size_t max) {
+    uint64_t buf[ZERO_SCAN_SIZE / sizeof(uint64_t)];
+    size_t run = 0;
+    
+    while (run < max) {
+#ifdef SEEK_DATA
+        off_t data = lseek(fd, offset + run, SEEK_DATA);
+        
+        if (data < 0 && errno == ENXIO)
+            return max;         // hole to the end of the file
+            
+        if (data > offset + (off_t) run) {
+            run = (size_t) (data - offset) < max ? data - offset : max;
+            continue;
+        }
+#endif
+        size_t len = max - run < sizeof(buf) ? max - run : sizeof(buf);
+        ssize_t bytes = pread(fd, buf, len, offset + run);
+        
+        if (bytes <= 0)
+            break;
+            
+        size_t zeros = zero_bytes(buf, bytes);
+        run += zeros;
+        
+        if (zeros < (size_t) bytes)
+            break;
+    }
+    
+    return run;
+}
+
+ssize_t read_segment(int infd, off_t offset, size_t remaining, 
+    segment_t* seg) {
+    size_t len = PAYLOAD_SIZE - 1;
+    
+    if (remaining < len)
+        len = remaining;
+    
+    /* zero the payload so that it is always a terminated string */
+    memset(seg->payload, 0, PAYLOAD_SIZE);
+    seg->type = DATA_SEG;
+    
+    ssize_t bytes = pread(infd, seg->payload, len, offset);
+    
+    if (bytes < 0)
+        return -1;
+    
+    /* the file ended early, it was truncated during the transfer */
+    if (!bytes && remaining) {
+        errno = EIO;
+        return -1;
+    }
+        
+    seg->payload_bytes = bytes;
+    seg->last = ((size_t) bytes == remaining);
+    
+    /* 
+     * a full chunk of zeros (each byte equal to the next, down to the '\0'
+     * terminator) starts a zero range
+     */
+    if (bytes == PAYLOAD_SIZE - 1 && !memcmp(seg->payload, 
+            seg->payload + 1, PAYLOAD_SIZE - 1)) {
+        size_t run = bytes + zero_run(infd, offset + bytes, 
+                                remaining - bytes);
+        
+        seg->type = ZERO_SEG;
+        seg->payload_bytes = run;
+        seg->last = (run == remaining);
+        bytes = run;
+    }
+    
+    return bytes;
+}
+
+ssize_t prepare_segment(int infd, off_t offset, size_t remaining, int sq,
+    bool corrupted, segment_t* seg) {
+    memset(seg, 0, sizeof(segment_t));
+    
+    uint64_t start = prof_start();
+    ssize_t bytes = read_segment(infd, offset, remaining, seg);
+    prof_end(PROF_READ, start);
+    
+    if (bytes < 0)
+        return bytes;
+        
+    seg->sq = sq;
+    
+    start = prof_start();
+    seg->checksum = checksum(seg->payload, corrupted);
+    prof_end(PROF_CHECKSUM, start);
+    
+    return bytes;
+}
+
+void prepare_metadata(metadata_t* file_inf, off_t size, const char* name,
+    int priority) {
+    memset(file_inf, 0, sizeof(metadata_t));
+    file_inf->size = size;
+    strncpy(file_inf->name, name, FILE_NAME_SIZE - 1);
+    file_inf->priority = priority;
+}
+
 void print_sep() {
+    uint64_t start = prof_start();
     printf("----------------------------------------------------------"
             "---------------------\n");
+    prof_end(PROF_PRINT, start);
 }
 
 void print_msg(char* role, char* msg) {
+    uint64_t start = prof_start();
     printf("%s: %s\n", role, msg);
+    prof_end(PROF_PRINT, start);
 }
 
 void print_err(char* role, int line, char* msg) {
@@ -9,17 +9,26 @@
 #define INF_MSG_SIZE 256    // max size of information messages to print out
 #define PORT_MIN 1025       // minimum network port number to use
 #define PORT_MAX 65535      // maximum network port number to use
+#define GSO_SEGS_MAX 16     // max data segments the client sends in one
+                            // UDP GSO burst before waiting for their ACKs
+#define GRO_BUF_SIZE 65536  // max size of a coalesced UDP GRO datagram
+#define ZERO_SCAN_SIZE 4096 // bytes of a file scanned at a time for zeros
+#define PRIO_MAX 3          // highest transfer priority hint (0 is bulk)
+#define FANOUT_MAX 16       // max servers a file is sent to in fan-out mode
 
 /* metadata to send to prepare for a file transfer */
 typedef struct metadata {
     off_t size;                 // size of the file to send
     char name[FILE_NAME_SIZE];  // name of the file to create on server
+    int priority;               // priority hint, 0 (bulk) to PRIO_MAX
 } metadata_t;
 
 /* segment types */
 typedef enum {
   DATA_SEG,    // data segment
-  ACK_SEG      // ack segment
+  ACK_SEG,     // ack segment
+  ZERO_SEG,    // zero range segment (payload_bytes of zeros, no payload)
+  NACK_SEG     // negative ack: segment sq was rejected and must be resent
 } seg_type;
 
 /* segment definition for chunks of file transfer data */
@@ -28,7 +37,10 @@ typedef struct segment {
     seg_type type;                  // segment type
     bool last;                      // last segment flag
     int checksum;                   // checksum of payload
-    size_t payload_bytes;           // bytes of payload (not incl. '\0')
+    size_t payload_bytes;           // bytes of payload (not incl. '\0'),
+                                    // for an ACK: the receive window, the
+                                    // number of segments the client may
+                                    // send before waiting for ACKs
     char payload[PAYLOAD_SIZE];     // payload data (file content in chunks)
 } segment_t;
 
@@ -47,6 +59,59 @@ typedef struct segment {
  */
 int checksum(char *payload, bool is_corrupted);
 
+/*
+ * read_segment - fill in a segment with the next chunk of a file. A chunk
+ * that is entirely zero bytes (or a hole in a sparse file) is extended to
+ * the end of the run of zeros and sent as a single ZERO_SEG, so that the
+ * zeros are neither read in full nor sent. Otherwise up to 
+ * PAYLOAD_SIZE - 1 bytes of the file are read into a DATA_SEG.
+ *
+ * Parameters:
+ * infd - open file descriptor of the file
+ * offset - offset in the file of the chunk
+ * remaining - bytes of the file from offset to its end
+ * seg - the segment to fill in (sq and checksum are left to the caller)
+ *
+ * Return:
+ * On success: the number of bytes of the file covered by the segment
+ * On failure: -1, also if the file ends before remaining bytes are read
+ */
+ssize_t read_segment(int infd, off_t offset, size_t remaining, 
+    segment_t* seg);
+
+/*
+ * prepare_segment - fill in data segment sq with the next chunk of a file,
+ * as read by read_segment, and the checksum of its payload. Reading and 
+ * the checksum are timed for profiling (see rft_prof.h).
+ *
+ * Parameters:
+ * infd - open file descriptor of the file
+ * offset - offset in the file of the chunk
+ * remaining - bytes of the file from offset to its end
+ * sq - the sequence number of the segment
+ * corrupted - a flag to indicate whether the checksum should be corrupted
+ * seg - the segment to fill in
+ *
+ * Return:
+ * On success: the number of bytes of the file covered by the segment
+ * On failure: -1
+ */
+ssize_t prepare_segment(int infd, off_t offset, size_t remaining, int sq,
+    bool corrupted, segment_t* seg);
+
+/*
+ * prepare_metadata - fill in the metadata for a file transfer
+ *
+ * Parameters:
+ * file_inf - the metadata to fill in
+ * size - the size of the file to send
+ * name - the name of the file to create on the server (truncated to 
+ *      FILE_NAME_SIZE - 1 characters)
+ * priority - the priority hint for the server, 0 (bulk) to PRIO_MAX
+ */
+void prepare_metadata(metadata_t* file_inf, off_t size, const char* name,
+    int priority);
+
 /* 
  * Information message functions 
  */